@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include "preprocess_ispc.h"
+
+// Benchmark the ISPC preprocessing kernels against equivalent serial
+// scalar loops, written the way the apps do their preprocessing while
+// loading particles, reporting the throughput of each in GB/s.
+
+using ispc::Particle;
+using ispc::Atom;
+
+static_assert(sizeof(Particle) == 5 * sizeof(float), "Particle layout must match the apps");
+static_assert(sizeof(Atom) == 4 * sizeof(float), "Atom layout must match the apps");
+
+const char* isa_name(const int isa) {
+	switch (isa) {
+		case 1: return "SSE4";
+		case 2: return "AVX2";
+		case 3: return "AVX-512 (SKX)";
+		default: return "unknown";
+	}
+}
+
+// Run the function a few times and return the best time, in seconds
+template<typename F>
+double best_time(F f) {
+	double best = std::numeric_limits<double>::max();
+	for (int i = 0; i < 10; ++i) {
+		auto start = std::chrono::high_resolution_clock::now();
+		f();
+		auto end = std::chrono::high_resolution_clock::now();
+		best = std::min(best, std::chrono::duration<double>(end - start).count());
+	}
+	return best;
+}
+
+void report(const std::string &name, const size_t bytes, const double scalar, const double simd) {
+	const double gb = bytes / 1e9;
+	std::cout << std::setw(20) << std::left << name << std::right << std::fixed
+		<< std::setprecision(2)
+		<< std::setw(10) << gb / scalar << " GB/s"
+		<< std::setw(10) << gb / simd << " GB/s"
+		<< std::setw(9) << scalar / simd << "x\n";
+}
+
+void check(const bool ok, const std::string &name) {
+	if (!ok) {
+		std::cerr << "Error: ISPC and scalar results differ for " << name << "\n";
+		std::exit(1);
+	}
+}
+
+void scalar_particles_to_soa(const std::vector<Particle> &particles, std::vector<float> &x,
+		std::vector<float> &y, std::vector<float> &z, std::vector<float> &radius,
+		std::vector<int32_t> &atom_type)
+{
+	for (size_t i = 0; i < particles.size(); ++i) {
+		x[i] = particles[i].x;
+		y[i] = particles[i].y;
+		z[i] = particles[i].z;
+		radius[i] = particles[i].radius;
+		atom_type[i] = particles[i].atom_type;
+	}
+}
+void scalar_soa_to_particles(const std::vector<float> &x, const std::vector<float> &y,
+		const std::vector<float> &z, const std::vector<float> &radius,
+		const std::vector<int32_t> &atom_type, std::vector<Particle> &particles)
+{
+	for (size_t i = 0; i < particles.size(); ++i) {
+		particles[i].x = x[i];
+		particles[i].y = y[i];
+		particles[i].z = z[i];
+		particles[i].radius = radius[i];
+		particles[i].atom_type = atom_type[i];
+	}
+}
+void scalar_atoms_to_soa(const std::vector<Atom> &atoms, std::vector<float> &x,
+		std::vector<float> &y, std::vector<float> &z, std::vector<float> &attrib)
+{
+	for (size_t i = 0; i < atoms.size(); ++i) {
+		x[i] = atoms[i].x;
+		y[i] = atoms[i].y;
+		z[i] = atoms[i].z;
+		attrib[i] = atoms[i].attrib;
+	}
+}
+void scalar_soa_to_atoms(const std::vector<float> &x, const std::vector<float> &y,
+		const std::vector<float> &z, const std::vector<float> &attrib, std::vector<Atom> &atoms)
+{
+	for (size_t i = 0; i < atoms.size(); ++i) {
+		atoms[i].x = x[i];
+		atoms[i].y = y[i];
+		atoms[i].z = z[i];
+		atoms[i].attrib = attrib[i];
+	}
+}
+void scalar_particle_bounds(const std::vector<Particle> &particles, float *bounds) {
+	std::fill(bounds, bounds + 3, std::numeric_limits<float>::max());
+	std::fill(bounds + 3, bounds + 6, std::numeric_limits<float>::lowest());
+	for (const auto &p : particles) {
+		bounds[0] = std::min(bounds[0], p.x - p.radius);
+		bounds[1] = std::min(bounds[1], p.y - p.radius);
+		bounds[2] = std::min(bounds[2], p.z - p.radius);
+		bounds[3] = std::max(bounds[3], p.x + p.radius);
+		bounds[4] = std::max(bounds[4], p.y + p.radius);
+		bounds[5] = std::max(bounds[5], p.z + p.radius);
+	}
+}
+// Scalar bounds and attribute range. read_xyz in the colormapped spheres app
+// only computes the attribute range, the bounds are added to match the kernel.
+void scalar_atom_bounds(const std::vector<Atom> &atoms, float *bounds, float *attrib_range) {
+	std::fill(bounds, bounds + 3, std::numeric_limits<float>::max());
+	std::fill(bounds + 3, bounds + 6, std::numeric_limits<float>::lowest());
+	attrib_range[0] = std::numeric_limits<float>::max();
+	attrib_range[1] = std::numeric_limits<float>::lowest();
+	for (const auto &a : atoms) {
+		bounds[0] = std::min(bounds[0], a.x);
+		bounds[1] = std::min(bounds[1], a.y);
+		bounds[2] = std::min(bounds[2], a.z);
+		bounds[3] = std::max(bounds[3], a.x);
+		bounds[4] = std::max(bounds[4], a.y);
+		bounds[5] = std::max(bounds[5], a.z);
+		attrib_range[0] = std::min(attrib_range[0], a.attrib);
+		attrib_range[1] = std::max(attrib_range[1], a.attrib);
+	}
+}
+void scalar_scale_radius(std::vector<Particle> &particles, const float scale) {
+	for (auto &p : particles) {
+		p.radius *= scale;
+	}
+}
+// Scalar type to attribute conversion, like the static_cast in read_xyz
+void scalar_particles_to_atoms(const std::vector<Particle> &particles, std::vector<Atom> &atoms) {
+	for (size_t i = 0; i < particles.size(); ++i) {
+		atoms[i].x = particles[i].x;
+		atoms[i].y = particles[i].y;
+		atoms[i].z = particles[i].z;
+		atoms[i].attrib = static_cast<float>(particles[i].atom_type);
+	}
+}
+
+bool same_particles(const std::vector<Particle> &a, const std::vector<Particle> &b) {
+	return std::equal(a.begin(), a.end(), b.begin(),
+			[](const Particle &x, const Particle &y) {
+				return x.x == y.x && x.y == y.y && x.z == y.z
+					&& x.radius == y.radius && x.atom_type == y.atom_type;
+			});
+}
+bool same_atoms(const std::vector<Atom> &a, const std::vector<Atom> &b) {
+	return std::equal(a.begin(), a.end(), b.begin(),
+			[](const Atom &x, const Atom &y) {
+				return x.x == y.x && x.y == y.y && x.z == y.z && x.attrib == y.attrib;
+			});
+}
+
+int main(int argc, char **argv) {
+#ifdef BENCH_CPU_FEATURE
+	// Single target builds will crash on CPUs without the ISA they
+	// were compiled for, so check before calling into ISPC
+	if (!__builtin_cpu_supports(BENCH_CPU_FEATURE)) {
+		std::cout << "Skipping " << argv[0] << ", the CPU does not support "
+			<< BENCH_CPU_FEATURE << "\n";
+		return 0;
+	}
+#endif
+	const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1 << 22;
+	std::cout << "ISPC target: " << isa_name(ispc::preprocess_target_isa())
+		<< ", " << ispc::preprocess_target_width() << " wide\n"
+		<< "Particles: " << n << "\n\n"
+		<< std::setw(20) << std::left << "kernel" << std::right
+		<< std::setw(15) << "scalar" << std::setw(15) << "ispc"
+		<< std::setw(10) << "speedup\n";
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> pos(-100.0, 100.0);
+	std::uniform_real_distribution<float> radius(0.15, 0.4);
+	std::uniform_int_distribution<int32_t> type(0, 10);
+
+	std::vector<Particle> particles(n);
+	for (auto &p : particles) {
+		p.x = pos(rng);
+		p.y = pos(rng);
+		p.z = pos(rng);
+		p.radius = radius(rng);
+		p.atom_type = type(rng);
+	}
+	std::vector<Atom> atoms(n), ispc_atoms(n);
+	scalar_particles_to_atoms(particles, atoms);
+
+	std::vector<float> x(n), y(n), z(n), attrib(n);
+	std::vector<int32_t> atom_type(n);
+	std::vector<float> ispc_x(n), ispc_y(n), ispc_z(n), ispc_attrib(n);
+	std::vector<int32_t> ispc_atom_type(n);
+	std::vector<Particle> out_particles(n), ispc_particles(n);
+
+	// Particle AoS <-> SoA
+	size_t bytes = 2 * n * sizeof(Particle);
+	double scalar = best_time([&]() {
+		scalar_particles_to_soa(particles, x, y, z, attrib, atom_type);
+	});
+	double simd = best_time([&]() {
+		ispc::particles_to_soa(particles.data(), ispc_x.data(), ispc_y.data(), ispc_z.data(),
+				ispc_attrib.data(), ispc_atom_type.data(), n);
+	});
+	check(x == ispc_x && y == ispc_y && z == ispc_z && attrib == ispc_attrib
+			&& atom_type == ispc_atom_type, "particles_to_soa");
+	report("particles_to_soa", bytes, scalar, simd);
+
+	scalar = best_time([&]() {
+		scalar_soa_to_particles(x, y, z, attrib, atom_type, out_particles);
+	});
+	simd = best_time([&]() {
+		ispc::soa_to_particles(x.data(), y.data(), z.data(), attrib.data(),
+				atom_type.data(), ispc_particles.data(), n);
+	});
+	check(same_particles(out_particles, particles) && same_particles(ispc_particles, particles),
+			"soa_to_particles");
+	report("soa_to_particles", bytes, scalar, simd);
+
+	// Atom AoS <-> SoA
+	bytes = 2 * n * sizeof(Atom);
+	scalar = best_time([&]() {
+		scalar_atoms_to_soa(atoms, x, y, z, attrib);
+	});
+	simd = best_time([&]() {
+		ispc::atoms_to_soa(atoms.data(), ispc_x.data(), ispc_y.data(), ispc_z.data(),
+				ispc_attrib.data(), n);
+	});
+	check(x == ispc_x && y == ispc_y && z == ispc_z && attrib == ispc_attrib, "atoms_to_soa");
+	report("atoms_to_soa", bytes, scalar, simd);
+
+	std::vector<Atom> out_atoms(n);
+	scalar = best_time([&]() {
+		scalar_soa_to_atoms(x, y, z, attrib, out_atoms);
+	});
+	simd = best_time([&]() {
+		ispc::soa_to_atoms(x.data(), y.data(), z.data(), attrib.data(), ispc_atoms.data(), n);
+	});
+	check(same_atoms(out_atoms, atoms) && same_atoms(ispc_atoms, atoms), "soa_to_atoms");
+	report("soa_to_atoms", bytes, scalar, simd);
+
+	// Bounds and attribute range reductions
+	float bounds[6], ispc_bounds[6];
+	scalar = best_time([&]() {
+		scalar_particle_bounds(particles, bounds);
+	});
+	simd = best_time([&]() {
+		ispc::particle_bounds(particles.data(), n, ispc_bounds);
+	});
+	check(std::equal(bounds, bounds + 6, ispc_bounds), "particle_bounds");
+	report("particle_bounds", n * sizeof(Particle), scalar, simd);
+
+	float attrib_range[2], ispc_attrib_range[2];
+	scalar = best_time([&]() {
+		scalar_atom_bounds(atoms, bounds, attrib_range);
+	});
+	simd = best_time([&]() {
+		ispc::atom_bounds(atoms.data(), n, ispc_bounds, ispc_attrib_range);
+	});
+	check(std::equal(bounds, bounds + 6, ispc_bounds)
+			&& std::equal(attrib_range, attrib_range + 2, ispc_attrib_range), "atom_bounds");
+	report("atom_bounds", n * sizeof(Atom), scalar, simd);
+
+	// Radius scaling, run on copies of the particles since it's done in place
+	// and we scale by 1 during timing to keep the values comparable. The scale
+	// is read from a volatile so the compiler can't remove the scalar loop.
+	volatile float unit_scale = 1.f;
+	out_particles = particles;
+	ispc_particles = particles;
+	scalar_scale_radius(out_particles, 2.f);
+	ispc::scale_radius(ispc_particles.data(), 2.f, n);
+	check(same_particles(out_particles, ispc_particles), "scale_radius");
+	scalar = best_time([&]() {
+		scalar_scale_radius(out_particles, unit_scale);
+	});
+	simd = best_time([&]() {
+		ispc::scale_radius(ispc_particles.data(), unit_scale, n);
+	});
+	report("scale_radius", 2 * n * sizeof(Particle), scalar, simd);
+
+	// Type to attribute conversion
+	scalar = best_time([&]() {
+		scalar_particles_to_atoms(particles, out_atoms);
+	});
+	simd = best_time([&]() {
+		ispc::particles_to_atoms(particles.data(), ispc_atoms.data(), n);
+	});
+	check(same_atoms(out_atoms, ispc_atoms), "particles_to_atoms");
+	report("particles_to_atoms", n * (sizeof(Particle) + sizeof(Atom)), scalar, simd);
+	return 0;
+}
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ISPC doesn't come with a task system, instead the code it generates for
+// launch and sync calls the three functions below, which we must provide.
+// This is a minimal implementation: ISPCLaunch runs the tasks right away
+// on a pool of worker threads and waits for them, which is valid since ISPC
+// only promises the tasks are done at the next sync. ISPCSync then just has
+// to free the memory ISPCAlloc gave out for the task arguments.
+
+typedef void (*TaskFn)(void *data, int threadIndex, int threadCount,
+		int taskIndex, int taskCount,
+		int taskIndex0, int taskIndex1, int taskIndex2,
+		int taskCount0, int taskCount1, int taskCount2);
+
+struct TaskGroup {
+	std::vector<void*> allocations;
+};
+
+// The worker threads are started on the first launch and reused for every
+// launch after, so a launch only costs waking them up instead of creating
+// and joining a set of threads.
+class TaskPool {
+	std::vector<std::thread> workers;
+	// Serializes launches made from different application threads
+	std::mutex launch_mutex;
+	std::mutex mutex;
+	std::condition_variable work_ready, work_done;
+	uint64_t generation = 0;
+	int active = 0;
+	bool quit = false;
+
+	// The launch currently being run
+	TaskFn fn = nullptr;
+	void *data = nullptr;
+	int count0 = 0, count1 = 0, count2 = 0, count = 0;
+	std::atomic<int> next_task;
+
+	// Set on threads that are running tasks from a launch
+	static thread_local bool in_launch;
+
+	// Pull task indices until all the tasks in the launch have been run
+	void run_tasks(const int thread_index) {
+		const int nthreads = static_cast<int>(workers.size()) + 1;
+		for (int i = next_task++; i < count; i = next_task++) {
+			fn(data, thread_index, nthreads, i, count,
+					i % count0, (i / count0) % count1, i / (count0 * count1),
+					count0, count1, count2);
+		}
+	}
+
+	void worker(const int thread_index) {
+		in_launch = true;
+		uint64_t seen = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				work_ready.wait(lock, [&]() { return quit || generation != seen; });
+				if (quit) {
+					return;
+				}
+				seen = generation;
+			}
+			run_tasks(thread_index);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--active == 0) {
+				work_done.notify_one();
+			}
+		}
+	}
+
+public:
+	TaskPool() : next_task(0) {
+		const int nthreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		for (int i = 1; i < nthreads; ++i) {
+			workers.emplace_back(&TaskPool::worker, this, i);
+		}
+	}
+	~TaskPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		work_ready.notify_all();
+		for (auto &t : workers) {
+			t.join();
+		}
+	}
+
+	static TaskPool& get() {
+		static TaskPool pool;
+		return pool;
+	}
+
+	void launch(TaskFn f, void *d, const int c0, const int c1, const int c2) {
+		// Tasks launching more tasks run them on their own thread, since
+		// the workers and the launching thread are busy with the launch that
+		// spawned them
+		if (in_launch) {
+			const int n = c0 * c1 * c2;
+			for (int i = 0; i < n; ++i) {
+				f(d, 0, 1, i, n, i % c0, (i / c0) % c1, i / (c0 * c1), c0, c1, c2);
+			}
+			return;
+		}
+
+		std::lock_guard<std::mutex> launch_lock(launch_mutex);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			fn = f;
+			data = d;
+			count0 = c0;
+			count1 = c1;
+			count2 = c2;
+			count = c0 * c1 * c2;
+			next_task = 0;
+			active = static_cast<int>(workers.size());
+			++generation;
+		}
+		work_ready.notify_all();
+		in_launch = true;
+		run_tasks(0);
+		in_launch = false;
+
+		std::unique_lock<std::mutex> lock(mutex);
+		work_done.wait(lock, [&]() { return active == 0; });
+	}
+};
+thread_local bool TaskPool::in_launch = false;
+
+static TaskGroup* get_group(void **handle) {
+	if (!*handle) {
+		*handle = new TaskGroup;
+	}
+	return static_cast<TaskGroup*>(*handle);
+}
+
+extern "C" void* ISPCAlloc(void **handle, int64_t size, int32_t alignment) {
+	TaskGroup *group = get_group(handle);
+	void *mem = nullptr;
+	const size_t align = std::max(static_cast<size_t>(alignment), sizeof(void*));
+	if (posix_memalign(&mem, align, size) != 0) {
+		return nullptr;
+	}
+	group->allocations.push_back(mem);
+	return mem;
+}
+
+extern "C" void ISPCLaunch(void **handle, void *f, void *data,
+		int count0, int count1, int count2)
+{
+	get_group(handle);
+	if (count0 * count1 * count2 == 0) {
+		return;
+	}
+	TaskPool::get().launch(reinterpret_cast<TaskFn>(f), data, count0, count1, count2);
+}
+
+extern "C" void ISPCSync(void *handle) {
+	if (!handle) {
+		return;
+	}
+	TaskGroup *group = static_cast<TaskGroup*>(handle);
+	for (void *mem : group->allocations) {
+		free(mem);
+	}
+	delete group;
+}
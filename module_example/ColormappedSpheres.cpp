@@ -14,10 +14,13 @@
 // limitations under the License.                                           //
 // ======================================================================== //
 
+#include <algorithm>
+#include <sstream>
 // ospray
 #include "ColormappedSpheres.h"
 #include "common/Data.h"
 #include "common/Model.h"
+#include "EmbreeMemoryMonitor.h"
 // ispc-generated files
 #include "ColormappedSpheres_ispc.h"
 
@@ -25,7 +28,35 @@ namespace vis17 {
 
   using namespace ospray;
 
+  /*! Rough peak memory used by Embree's BVH build per sphere, used to check
+      the budget before the build starts. The build needs a primitive
+      reference for each sphere along with the BVH nodes and leaves, compact
+      mode puts more spheres in each leaf to need fewer nodes. */
+  static const size_t BVH_BYTES_PER_SPHERE = 80;
+  static const size_t COMPACT_BVH_BYTES_PER_SPHERE = 56;
+
+  static float toMB(const size_t bytes)
+  {
+    return bytes / (1024.f * 1024.f);
+  }
+
+  /*! the first colormapped spheres geometry in the model, which is the
+      first to be finalized in each of the model's commits */
+  static ColormappedSpheres *firstColormappedSpheres(Model *model)
+  {
+    for (auto &g : model->geometry) {
+      auto *spheres = dynamic_cast<ColormappedSpheres*>(g.ptr);
+      if (spheres) {
+        return spheres;
+      }
+    }
+    return nullptr;
+  }
+
   ColormappedSpheres::ColormappedSpheres()
+    : dataBytes(0),
+      dataShared(false),
+      bvhEstimateBytes(0)
   {
     this->ispcEquivalent = ispc::ColormappedSpheres_create(this);
   }
@@ -36,6 +67,24 @@ namespace vis17 {
   }
 
   void ColormappedSpheres::finalize(Model *model)
+  {
+    // Track the memory of each of the model's builds, starting before
+    // anything in the commit can fail
+    EmbreeMemoryMonitor &monitor = EmbreeMemoryMonitor::instance();
+    if (firstColormappedSpheres(model) == this) {
+      monitor.beginBuild(model);
+    }
+    try {
+      finalizeGeometry(model);
+    } catch (...) {
+      // Lift the budget so it doesn't refuse allocations of later builds,
+      // over budget errors have already recorded why they failed
+      monitor.failBuild(model, VIS17_MEMORY_BUILD_FAILED);
+      throw;
+    }
+  }
+
+  void ColormappedSpheres::finalizeGeometry(Model *model)
   {
     radius            = getParam1f("radius", 0.01f);
     materialID        = getParam1i("materialID", 0);
@@ -71,6 +120,29 @@ namespace vis17 {
                                "without causing address overflows)");
     }
 
+    // Account for the memory this geometry will use. The data only counts
+    // against the budget if OSPRay made a copy of it.
+    const bool compactMode = model->getParam1i("compactMode", 0);
+    dataBytes = sphereData->numBytes;
+    dataShared = sphereData->flags & OSP_DATA_SHARED_BUFFER;
+    bvhEstimateBytes = numSpheres * (compactMode ? COMPACT_BVH_BYTES_PER_SPHERE
+                                                 : BVH_BYTES_PER_SPHERE);
+    // reject a bad budget even if this isn't the geometry checking it
+    budgetBytes();
+
+    set("memory_data_mb", toMB(dataBytes));
+    set("memory_data_shared", int32_t(dataShared));
+    set("memory_bvh_estimate_mb", toMB(bvhEstimateBytes));
+    postStatusMsg(2) << "#vis17: 'colormapped_spheres' data = " << toMB(dataBytes)
+                     << "MB (" << (dataShared ? "shared" : "copied")
+                     << "), estimated BVH build = " << toMB(bvhEstimateBytes) << "MB";
+
+    // The budget covers the whole model, so it's checked once per commit
+    // before anything is built
+    if (firstColormappedSpheres(model) == this) {
+      checkModelBudget(model, compactMode);
+    }
+
     ispc::ColormappedSpheresGeometry_set(getIE(),
                                          model->getIE(),
                                          sphereData->data,
@@ -84,6 +156,102 @@ namespace vis17 {
                                          transferFunction->getIE());
   }
 
+  size_t ColormappedSpheres::budgetBytes()
+  {
+    const float budget = getParam1f("memory_budget_mb", 0.f);
+    if (!(budget >= 0.f)) {
+      throw std::runtime_error("#vis17:ColormappedSpheres: 'memory_budget_mb' "
+                               "must be 0 (no budget) or positive");
+    }
+    return budget * 1024 * 1024;
+  }
+
+  void ColormappedSpheres::checkModelBudget(Model *model, const bool compactMode)
+  {
+    // The other geometries haven't been finalized yet in this commit,
+    // so their sizes are read from their parameters
+    size_t budget = 0;
+    size_t copiedBytes = 0;
+    size_t modelSpheres = 0;
+    for (auto &g : model->geometry) {
+      auto *spheres = dynamic_cast<ColormappedSpheres*>(g.ptr);
+      if (!spheres) {
+        continue;
+      }
+      const size_t geomBudget = spheres->budgetBytes();
+      if (geomBudget != 0 && (budget == 0 || geomBudget < budget)) {
+        budget = geomBudget;
+      }
+      Data *data = spheres->getParamData("spheres");
+      const int32_t stride = spheres->getParam1i("bytes_per_sphere", 4*sizeof(float));
+      if (data && stride > 0) {
+        if (!(data->flags & OSP_DATA_SHARED_BUFFER)) {
+          copiedBytes += data->numBytes;
+        }
+        modelSpheres += data->numBytes / stride;
+      }
+    }
+    if (budget == 0) {
+      return;
+    }
+
+    const size_t estimate = copiedBytes + modelSpheres
+      * (compactMode ? COMPACT_BVH_BYTES_PER_SPHERE : BVH_BYTES_PER_SPHERE);
+    if (estimate > budget) {
+      std::stringstream msg;
+      msg << "#vis17:ColormappedSpheres: estimated memory use of the model, "
+          << toMB(estimate) << "MB, exceeds the 'memory_budget_mb' of "
+          << toMB(budget) << "MB";
+      const size_t compactEstimate = copiedBytes
+        + modelSpheres * COMPACT_BVH_BYTES_PER_SPHERE;
+      if (!compactMode && compactEstimate <= budget) {
+        msg << ". A compact BVH is estimated to fit (" << toMB(compactEstimate)
+            << "MB), set 'compactMode' on the model to use it";
+      }
+      EmbreeMemoryMonitor::instance().failBuild(model, VIS17_MEMORY_OVER_BUDGET);
+      throw std::runtime_error(msg.str());
+    }
+    // The copied data is already allocated, Embree gets the rest
+    EmbreeMemoryMonitor::instance().setBudget(std::max(budget - copiedBytes, size_t(1)));
+  }
+
+  VIS17MemoryStatus ColormappedSpheres::reportModelMemory(Model *model)
+  {
+    EmbreeMemoryMonitor::BuildStats stats;
+    if (!EmbreeMemoryMonitor::instance().endBuild(model, stats)) {
+      return VIS17_MEMORY_OK;
+    }
+
+    // The BVH is shared by the whole model, so the model reports the
+    // totals over all the colormapped spheres in it
+    size_t copiedBytes = 0;
+    size_t sharedBytes = 0;
+    for (auto &g : model->geometry) {
+      auto *spheres = dynamic_cast<ColormappedSpheres*>(g.ptr);
+      if (spheres) {
+        (spheres->dataShared ? sharedBytes : copiedBytes) += spheres->dataBytes;
+      }
+    }
+    model->set("memory_status", int32_t(stats.status));
+    model->set("memory_data_copied_mb", toMB(copiedBytes));
+    model->set("memory_data_shared_mb", toMB(sharedBytes));
+    model->set("memory_bvh_mb", toMB(stats.bvhBytes));
+    model->set("memory_peak_mb", toMB(stats.peakBytes));
+    model->set("memory_total_mb", toMB(copiedBytes + stats.bvhBytes));
+
+    if (stats.status != VIS17_MEMORY_OK) {
+      postStatusMsg(1) << "#vis17: model build failed"
+                       << (stats.status == VIS17_MEMORY_BUILD_FAILED ? ""
+                           : ", it does not fit in its memory budget");
+    } else {
+      postStatusMsg(1) << "#vis17: model memory: BVH = " << toMB(stats.bvhBytes)
+                       << "MB (peak " << toMB(stats.peakBytes) << "MB during build), "
+                       << "copied data = " << toMB(copiedBytes) << "MB, "
+                       << "shared data = " << toMB(sharedBytes) << "MB";
+    }
+    return stats.status;
+  }
+
   OSP_REGISTER_GEOMETRY(ColormappedSpheres,colormapped_spheres);
 
 } // ::ospray
@@ -20,16 +20,7 @@
 #include "common/Model.h"
 #include "common/Data.h"
 #include "transferFunction/TransferFunction.h"
-
-#if defined (_WIN32)
-  #if defined(ospray_module_colormapped_spheres_EXPORTS)
-    #define VIS17_COLORMAPPED_SPHERES_EXPORT __declspec(dllexport)
-  #else
-    #define VIS17_COLORMAPPED_SPHERES_EXPORT __declspec(dllimport)
-  #endif
-#else
-  #define VIS17_COLORMAPPED_SPHERES_EXPORT
-#endif
+#include "ColormappedSpheresMemory.h"
 
 
 namespace vis17 {
@@ -43,6 +34,10 @@ namespace vis17 {
     virtual std::string toString() const override;
     virtual void finalize(ospray::Model *model) override;
 
+    /*! Called once the model's commit has returned, see
+        vis17_colormapped_spheres_commit_done */
+    static VIS17MemoryStatus reportModelMemory(ospray::Model *model);
+
     /*! default radius, if no per-sphere radius was specified. */
     float radius;
     int32_t materialID;
@@ -56,6 +51,20 @@ namespace vis17 {
 
     ospray::Ref<ospray::Data> sphereData;
     ospray::Ref<ospray::TransferFunction> transferFunction;
+
+    /*! memory accounting, in bytes. The data is only counted against the
+        budget if OSPRay made a copy of it, shared buffers belong to the app */
+    size_t dataBytes;
+    bool dataShared;
+    size_t bvhEstimateBytes;
+
+  private:
+    void finalizeGeometry(ospray::Model *model);
+    /*! check the estimated memory use of all the colormapped spheres in
+        the model against their budget, and arm the budget for the build */
+    static void checkModelBudget(ospray::Model *model, const bool compactMode);
+    /*! the budget set on this geometry in bytes, 0 if none */
+    size_t budgetBytes();
   };
 
 }
@@ -0,0 +1,57 @@
+// ======================================================================== //
+// Copyright 2009-2017 Intel Corporation                                    //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+#include <ospray/ospray.h>
+
+#if defined (_WIN32)
+  #if defined(ospray_module_colormapped_spheres_EXPORTS)
+    #define VIS17_COLORMAPPED_SPHERES_EXPORT __declspec(dllexport)
+  #else
+    #define VIS17_COLORMAPPED_SPHERES_EXPORT __declspec(dllimport)
+  #endif
+#else
+  #define VIS17_COLORMAPPED_SPHERES_EXPORT
+#endif
+
+/*! Result of committing a model with colormapped spheres in it */
+typedef enum {
+  /*! the model was built within its memory budget */
+  VIS17_MEMORY_OK = 0,
+  /*! the estimated memory use was over the budget, so the commit failed
+      before building anything */
+  VIS17_MEMORY_OVER_BUDGET = 1,
+  /*! Embree went over the budget while building the BVH and the build
+      was stopped */
+  VIS17_MEMORY_ALLOCATION_REFUSED = 2,
+  /*! the commit failed for some other reason, e.g. a missing parameter */
+  VIS17_MEMORY_BUILD_FAILED = 3,
+  /*! memory accounting isn't available on the current device, only the
+      local device is supported */
+  VIS17_MEMORY_UNSUPPORTED_DEVICE = 4
+} VIS17MemoryStatus;
+
+/*! Optionally called after an ospCommit of a model with colormapped spheres
+    in it, from the thread that committed it. ospCommit reports errors to
+    the device instead of returning them, so this returns whether the model
+    was built, and within its budget. It also measures the memory Embree kept
+    for the BVH and sets the model's memory_* parameters. The module lifts
+    the budget on its own once Embree's build is done, so apps that don't
+    need the result don't have to call this. Only supported on the local
+    device, other devices return VIS17_MEMORY_UNSUPPORTED_DEVICE. */
+extern "C" VIS17_COLORMAPPED_SPHERES_EXPORT
+VIS17MemoryStatus vis17_colormapped_spheres_commit_done(OSPModel model);
@@ -0,0 +1,158 @@
+// ======================================================================== //
+// Copyright 2009-2017 Intel Corporation                                    //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#include <algorithm>
+#include <stdexcept>
+// ospray
+#include "api/ISPCDevice.h"
+#include "common/Model.h"
+#include "EmbreeMemoryMonitor.h"
+
+namespace vis17 {
+
+  EmbreeMemoryMonitor &EmbreeMemoryMonitor::instance()
+  {
+    static EmbreeMemoryMonitor monitor;
+    return monitor;
+  }
+
+  bool EmbreeMemoryMonitor::localDevice()
+  {
+    using namespace ospray::api;
+    return dynamic_cast<ISPCDevice*>(Device::current.ptr) != nullptr;
+  }
+
+  void EmbreeMemoryMonitor::install()
+  {
+    // Only the local device builds its models with Embree in this process,
+    // e.g. on the MPI device the workers do
+    if (!localDevice()) {
+      ospray::postStatusMsg(1) << "#vis17: not running on the local device, "
+                               << "memory accounting is disabled";
+      return;
+    }
+    device = ospray::api::ISPCDevice::embreeDevice;
+    if (!device) {
+      throw std::runtime_error("#vis17:EmbreeMemoryMonitor: no Embree device, "
+                               "was ospInit called?");
+    }
+    rtcDeviceSetMemoryMonitorFunction2(device, &EmbreeMemoryMonitor::monitor, this);
+  }
+
+  void EmbreeMemoryMonitor::beginBuild(const ospray::Model *model)
+  {
+    if (!device) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(buildMutex);
+    buildModel = model;
+    status = VIS17_MEMORY_OK;
+    baseline = current.load();
+    peak = 0;
+    refused = false;
+    built = false;
+    budget = 0;
+    // Embree keeps the first error on each thread until it's read, clear
+    // any left from before this build
+    rtcDeviceGetError(device);
+    rtcSetProgressMonitorFunction(model->embreeSceneHandle,
+                                  &EmbreeMemoryMonitor::progress, this);
+  }
+
+  void EmbreeMemoryMonitor::setBudget(size_t newBudget)
+  {
+    std::lock_guard<std::mutex> lock(buildMutex);
+    if (buildModel && status == VIS17_MEMORY_OK) {
+      budget = newBudget;
+    }
+  }
+
+  void EmbreeMemoryMonitor::failBuild(const ospray::Model *model,
+                                      VIS17MemoryStatus failure)
+  {
+    std::lock_guard<std::mutex> lock(buildMutex);
+    budget = 0;
+    // Builds are started before anything in the commit can fail, but if
+    // we're somehow not tracking this model still record its failure
+    if (model != buildModel) {
+      buildModel = model;
+      baseline = current.load();
+      peak = 0;
+      refused = false;
+      status = failure;
+    } else if (status == VIS17_MEMORY_OK) {
+      status = failure;
+    }
+  }
+
+  bool EmbreeMemoryMonitor::endBuild(const ospray::Model *model, BuildStats &stats)
+  {
+    std::lock_guard<std::mutex> lock(buildMutex);
+    budget = 0;
+    if (model != buildModel) {
+      return false;
+    }
+    buildModel = nullptr;
+
+    // A refused allocation shows up as an out of memory error, any other
+    // error from Embree also means the build failed
+    const bool embreeError = device && rtcDeviceGetError(device) != RTC_NO_ERROR;
+    stats.status = status;
+    if (status == VIS17_MEMORY_OK && refused) {
+      stats.status = VIS17_MEMORY_ALLOCATION_REFUSED;
+    } else if (status == VIS17_MEMORY_OK && embreeError) {
+      stats.status = VIS17_MEMORY_BUILD_FAILED;
+    }
+    stats.bvhBytes = std::max(current - baseline, int64_t(0));
+    stats.peakBytes = peak.load();
+    return true;
+  }
+
+  bool EmbreeMemoryMonitor::monitor(void *ptr, const ssize_t bytes, const bool post)
+  {
+    EmbreeMemoryMonitor *self = static_cast<EmbreeMemoryMonitor*>(ptr);
+    // Embree reports refused allocations back to us as a free with post set,
+    // so every call is counted to keep the total balanced.
+    const int64_t used = (self->current += bytes) - self->baseline;
+    int64_t limit = self->budget.load();
+    if (!post && bytes > 0 && limit != 0 && used > limit) {
+      // Refusing the allocation fails the build, so lift the budget
+      // to not refuse unrelated allocations made after it.
+      self->budget.compare_exchange_strong(limit, 0);
+      self->refused = true;
+      return false;
+    }
+
+    int64_t prevPeak = self->peak.load();
+    while (used > prevPeak && !self->peak.compare_exchange_weak(prevPeak, used));
+    return true;
+  }
+
+  bool EmbreeMemoryMonitor::progress(void *ptr, const double done)
+  {
+    EmbreeMemoryMonitor *self = static_cast<EmbreeMemoryMonitor*>(ptr);
+    // Lift the budget once Embree is done building, so the app doesn't
+    // have to end the build before its allocations are no longer limited
+    if (done >= 1.0 && !self->built.exchange(true)) {
+      self->budget = 0;
+      ospray::postStatusMsg(1) << "#vis17: BVH built, peak memory allocated by "
+                               << "Embree during the build = "
+                               << self->peak / (1024.f * 1024.f) << "MB";
+    }
+    return true;
+  }
+
+}
@@ -0,0 +1,92 @@
+// ======================================================================== //
+// Copyright 2009-2017 Intel Corporation                                    //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+// embree
+#include "embree2/rtcore.h"
+#include "ColormappedSpheresMemory.h"
+
+namespace ospray {
+  struct Model;
+}
+
+namespace vis17 {
+
+  /*! Tracks the memory Embree allocates on OSPRay's device through Embree's
+      memory monitor callback. Embree only reports device wide allocations,
+      so everything allocated from the start of a model's commit until the
+      next build or the call to endBuild is attributed to that model. This
+      is exact as long as models are committed one at a time. */
+  struct EmbreeMemoryMonitor
+  {
+    struct BuildStats
+    {
+      VIS17MemoryStatus status;
+      /*! bytes Embree kept after the build and the peak during it */
+      size_t bvhBytes;
+      size_t peakBytes;
+    };
+
+    static EmbreeMemoryMonitor &instance();
+
+    /*! whether OSPRay's current device is the local one, which builds the
+        models in this process */
+    static bool localDevice();
+    /*! install the memory monitor callback on OSPRay's Embree device, does
+        nothing if the device isn't local */
+    void install();
+
+    /*! start a new build, called once at the start of each commit of the
+        model from the committing thread. Anything left from earlier builds
+        is reset, whether they ended or not, since a new scene or model may
+        reuse a freed one's address. Also hooks the progress of the build
+        on the model's scene, to lift the budget once Embree is done. */
+    void beginBuild(const ospray::Model *model);
+    /*! let Embree allocate up to budget bytes during the current build, past
+        the budget allocations are refused and the build fails */
+    void setBudget(size_t budget);
+    /*! mark the model's build as failed and lift its budget */
+    void failBuild(const ospray::Model *model, VIS17MemoryStatus status);
+    /*! end the model's build once its commit has returned, called from
+        the committing thread to pick up Embree's errors for the build.
+        Returns false if no build of the model is being tracked. */
+    bool endBuild(const ospray::Model *model, BuildStats &stats);
+
+  private:
+    static bool monitor(void *ptr, const ssize_t bytes, const bool post);
+    static bool progress(void *ptr, const double done);
+
+    RTCDevice device {nullptr};
+
+    std::mutex buildMutex;
+    /*! the model being built, cleared once its build has ended */
+    const ospray::Model *buildModel {nullptr};
+    VIS17MemoryStatus status {VIS17_MEMORY_OK};
+
+    std::atomic<int64_t> current {0};
+    std::atomic<int64_t> baseline {0};
+    std::atomic<int64_t> peak {0};
+    std::atomic<int64_t> budget {0};
+    std::atomic<bool> refused {false};
+    /*! set once Embree reports the build's progress as done */
+    std::atomic<bool> built {false};
+  };
+
+}
@@ -7,6 +7,7 @@
 #include <array>
 #include <cstdio>
 #include <ospray/ospray.h>
+#include "ColormappedSpheresMemory.h"
 
 struct Atom {
   float x, y, z;
@@ -40,6 +41,7 @@ int main(int argc, const char **argv) {
   std::array<float, 3> cam_pos = {0.0, 0.0, 9.0};
   std::array<float, 3> cam_up = {0.0, 1.0, 0.0};
   std::array<float, 3> cam_at = {0.0, 0.0, 0.0};
+  float memory_budget = 0.f;
   for (int i = 0; i < argc; ++i) {
     if (std::strcmp(argv[i], "-xyz") == 0) {
       xyz_file = argv[++i];
@@ -55,6 +57,8 @@ int main(int argc, const char **argv) {
       for (size_t j = 0; j < 3; ++j) {
         cam_at[j] = std::atof(argv[++i]);
       }
+    } else if (std::strcmp(argv[i], "-budget") == 0) {
+      memory_budget = std::atof(argv[++i]);
     }
   }
   std::array<float, 3> cam_dir;
@@ -118,6 +122,11 @@ int main(int argc, const char **argv) {
   // defaults to 0.
   ospSet1f(spheres, "bytes_per_sphere", sizeof(Atom));
   ospSet1i(spheres, "offset_attribute", 3 * sizeof(float));
+  // Optionally limit how much memory the geometry can use, in MB, including
+  // any copies of the data and the BVH built over the spheres
+  if (memory_budget > 0.f) {
+    ospSet1f(spheres, "memory_budget_mb", memory_budget);
+  }
 
   // We'll use the scivis renderer, this renderer computes ambient occlusion
   // and shadows for enhanced depth cues
@@ -138,6 +147,28 @@ int main(int argc, const char **argv) {
   OSPModel model = ospNewModel();
   ospAddGeometry(model, spheres);
   ospCommit(model);
+  // ospCommit reports errors to the device instead of returning them, so ask
+  // our module whether the model was built. If it didn't fit in the memory
+  // budget, fall back to building a compact BVH which needs less memory,
+  // at some cost in render performance.
+  VIS17MemoryStatus status = vis17_colormapped_spheres_commit_done(model);
+  if (status == VIS17_MEMORY_OVER_BUDGET || status == VIS17_MEMORY_ALLOCATION_REFUSED) {
+    std::cout << "Model does not fit in the memory budget, retrying with a compact BVH\n";
+    ospSet1i(model, "compactMode", 1);
+    ospCommit(model);
+    status = vis17_colormapped_spheres_commit_done(model);
+  }
+  if (status == VIS17_MEMORY_UNSUPPORTED_DEVICE) {
+    std::cout << "Memory accounting is not supported on this device\n";
+  } else if (status != VIS17_MEMORY_OK) {
+    std::cerr << "Failed to build the model"
+      << (status == VIS17_MEMORY_BUILD_FAILED ? "" : " within the memory budget") << "\n";
+    return 1;
+  }
+  float memory_mb = 0.f;
+  if (ospGetf(model, "memory_total_mb", &memory_mb)) {
+    std::cout << "Model memory use: " << memory_mb << "MB\n";
+  }
 
   // Setup the camera we'll render the scene from
   const osp::vec2i img_size{1024, 1024};
@@ -1,7 +1,19 @@
 #include <iostream>
 #include "ColormappedSpheres.h"
+#include "EmbreeMemoryMonitor.h"
 
 extern "C" VIS17_COLORMAPPED_SPHERES_EXPORT void ospray_init_module_colormapped_spheres() {
   std::cout << "vis17: ColorMapped spheres module initializing" << std::endl;
+  vis17::EmbreeMemoryMonitor::instance().install();
+}
+
+extern "C" VIS17_COLORMAPPED_SPHERES_EXPORT
+VIS17MemoryStatus vis17_colormapped_spheres_commit_done(OSPModel model) {
+  // Only on the local device is the handle the model itself, other devices
+  // hand out handles to objects living in other processes
+  if (!vis17::EmbreeMemoryMonitor::localDevice()) {
+    return VIS17_MEMORY_UNSUPPORTED_DEVICE;
+  }
+  return vis17::ColormappedSpheres::reportModelMemory((ospray::Model*)model);
 }
 